@@ -93,6 +93,17 @@ void stats_abort_locked(void)
      pthread_mutex_unlock(&s_stats.mutex);
 }
 
+/*
+ * Called by server threads when all multicast sessions for a file have
+ * reached the maximum number of clients.
+ */
+void stats_mcast_split_locked(void)
+{
+     pthread_mutex_lock(&s_stats.mutex);
+     s_stats.num_mcast_split++;
+     pthread_mutex_unlock(&s_stats.mutex);
+}
+
 /*
  * Called by main thread only (in fact in tftpd_receive_request(), but
  * before stdin_mutex is released) every time a new thread is created.
@@ -177,4 +188,5 @@ void stats_print(void)
      logger(LOG_INFO, "   number of errors:         %d", s_stats.number_of_err);
      logger(LOG_INFO, "   number of files sent:     %d", s_stats.num_file_send);
      logger(LOG_INFO, "   number of files received: %d", s_stats.num_file_recv);
+     logger(LOG_INFO, "   multicast session splits: %d", s_stats.num_mcast_split);
 }
@@ -44,6 +44,7 @@ struct server_stats {
      int number_of_err;         /* send or receive that return with error */
      int num_file_send;
      int num_file_recv;
+     int num_mcast_split;       /* new multicast session, others are full */
      int byte_send;             /* total byte transferred to client (file) */
      int byte_recv;             /* total byte read from client (file) */
 };
@@ -55,6 +56,7 @@ void stats_send_locked(void);
 void stats_recv_locked(void);
 void stats_err_locked(void);
 void stats_abort_locked(void);
+void stats_mcast_split_locked(void);
 void stats_new_thread(int number_of_thread);
 void stats_thread_usage_locked(void);
 void stats_print(void);
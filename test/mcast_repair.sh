@@ -0,0 +1,44 @@
+#!/bin/bash
+#
+# Compare multicast transfer with and without repair mode. The server
+# must run with --mcast-repair and atftp must be built with --enable-debug
+# for the --drop option. Clients are started at the same time, they all
+# join the same multicast session.
+#
+
+if [ $# -lt 1 ]; then
+    echo "Usage: mcast_repair.sh [host] [port]"
+    exit 1
+fi
+
+TFTP=../atftp
+HOST=$1
+PORT=$2
+FILE=linux
+CONCURENT=100
+DROP=1
+
+for MODE in "" "--option repair"; do
+    echo -n "${MODE:-classic}: "
+    START=$(date +%s)
+    j=$CONCURENT
+    while [ $j -gt 0 ]; do
+	$TFTP --option "blksize 1024" --option multicast $MODE --drop $DROP \
+	    --get -r $FILE -l $j.bin $HOST $PORT 2>$j.out&
+	j=$[ $j - 1 ]
+    done
+    wait
+    STOP=$(date +%s)
+    OK=0
+    j=$CONCURENT
+    while [ $j -gt 0 ]; do
+	if grep -q "error" $j.out; then
+	    :
+	elif [ -s $j.bin ]; then
+	    OK=$[ $OK + 1 ]
+	fi
+	rm -f $j.bin $j.out
+	j=$[ $j - 1 ]
+    done
+    echo "$OK/$CONCURENT clients in $[ $STOP - $START ]s"
+done
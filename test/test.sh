@@ -423,6 +423,50 @@ fi
 #
 
 
+#
+# testing the stat cache: changes to the directory must be seen by the
+# server without restarting it
+#
+OUTPUTFILE="07-out"
+stop_server
+OLD_ARGS="$SERVER_ARGS"
+SERVER_ARGS="$SERVER_ARGS --stat-cache"
+start_server
+echo
+echo "Testing stat cache..."
+echo -n " size update ... "
+cp $DIRECTORY/$READ_2K $DIRECTORY/cache.bin
+$ATFTP --option "tsize" --get -r cache.bin -l /dev/null $HOST $PORT 2> /dev/null
+cp $DIRECTORY/$READ_BIG $DIRECTORY/cache.bin
+sleep 1
+$ATFTP --option "tsize" --trace --get -r cache.bin -l out.bin $HOST $PORT 2> "$OUTPUTFILE"
+TSIZE=$(grep "OACK <tsize:" "$OUTPUTFILE" | sed -e "s/[^0-9]//g")
+if [ "$TSIZE" != "51111" ]; then
+	echo "ERROR (server report $TSIZE bytes but it should be 51111)"
+	ERROR=1
+else
+	check_file $DIRECTORY/$READ_BIG out.bin
+fi
+echo -n " file removed ... "
+rm -f $DIRECTORY/cache.bin
+sleep 1
+$ATFTP --trace --get -r cache.bin -l /dev/null $HOST $PORT 2> "$OUTPUTFILE"
+if grep -q "<File not found>" "$OUTPUTFILE"; then
+	echo OK
+else
+	echo ERROR
+	ERROR=1
+fi
+echo -n " file created ... "
+cp $DIRECTORY/$READ_2K $DIRECTORY/cache.bin
+sleep 1
+$ATFTP --get -r cache.bin -l out.bin $HOST $PORT 2> /dev/null
+check_file $DIRECTORY/$READ_2K out.bin
+rm -f $DIRECTORY/cache.bin out.bin
+stop_server
+SERVER_ARGS="$OLD_ARGS"
+start_server
+
 #
 # Test for high server load
 #
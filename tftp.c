@@ -32,6 +32,7 @@
 #include <netdb.h>
 
 #include <signal.h>
+#include <time.h>
 
 #if HAVE_READLINE
 #include <readline/readline.h>
@@ -175,6 +176,8 @@ int main(int argc, char **argv)
      data.verbose = 0;
 #ifdef DEBUG
      data.delay = 0;
+     data.drop = 0;
+     srand(time(NULL) ^ getpid());
 #endif
 
      /* register SIGINT -> C-c */
@@ -545,6 +548,10 @@ int set_option(int argc, char **argv)
                fprintf(stderr, "  multicast: enabled\n");
           else
                fprintf(stderr, "  multicast: disabled\n");
+          if (data.tftp_options[OPT_REPAIR].specified)
+               fprintf(stderr, "  repair:    enabled\n");
+          else
+               fprintf(stderr, "  repair:    disabled\n");
           if (data.tftp_options[OPT_PASSWORD].specified)
                fprintf(stderr, "   password: enabled\n");
           else
@@ -891,6 +898,10 @@ int status(int argc, char **argv)
           fprintf(stderr, " multicast: enabled\n");
      else
           fprintf(stderr, " multicast: disabled\n");
+     if (data.tftp_options[OPT_REPAIR].specified)
+          fprintf(stderr, " repair:    enabled\n");
+     else
+          fprintf(stderr, " repair:    disabled\n");
 #ifdef HAVE_MTFTP
      fprintf(stderr, "mtftp variables\n");
      fprintf(stderr, " client-port:   %d\n", data.mtftp_client_port);
@@ -1015,6 +1026,7 @@ int tftp_cmd_line_options(int argc, char **argv)
           { "trace", 0, NULL, 'd'},
 #if DEBUG
           { "delay", 1, NULL, 'D'},
+          { "drop", 1, NULL, 'x'},
 #endif
           { "version", 0, NULL, 'V'},
           { "help", 0, NULL, 'h' },
@@ -1137,6 +1149,9 @@ int tftp_cmd_line_options(int argc, char **argv)
           case 'D':
                data.delay = atoi(optarg);
                break;
+          case 'x':
+               data.drop = atoi(optarg);
+               break;
 #endif
           case 'V':
                fprintf(stderr, "atftp-%s (client)\n", VERSION);
@@ -1239,6 +1254,7 @@ void tftp_usage(void)
              "  --trace                  : set trace mode on\n"
 #if DEBUG
              "  --delay                  : add delay in state machine for debugging\n"
+             "  --drop <percent>         : randomly drop received DATA packets\n"
 #endif
              "  -V, --version            : print version information\n"
              "  -h, --help               : print this help\n"
@@ -61,6 +61,7 @@ struct client_data {
 
 #if DEBUG
      int delay;
+     int drop;                  /* percent of DATA packets to discard */
 #endif
 
 };
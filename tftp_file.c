@@ -95,6 +95,39 @@ int tftp_find_bitmap_hole(int prev_hole, unsigned int *bitmap)
      return (next_word_no * 32) + next_bit_no;
 }
 
+/*
+ * Build the list of missing blocks after hole for a repair report. Ranges
+ * are scanned up to last, the last block if known. Return the number of
+ * ranges stored in ranges, at most max.
+ */
+static int tftp_find_bitmap_ranges(int hole, long last, long max_block,
+                                   unsigned int *bitmap, unsigned short *ranges,
+                                   int max)
+{
+     long block;
+     long end = (last > 0) ? last : max_block;
+     int nb = 0;
+
+     for (block = hole + 2; (block <= end) && (nb < max); block++)
+     {
+          if (bitmap[(block - 1) / 32] & (1 << ((block - 1) % 32)))
+               continue;
+          ranges[2 * nb] = block;
+          while ((block < end) &&
+                 !(bitmap[block / 32] & (1 << (block % 32))))
+               block++;
+          ranges[2 * nb + 1] = block;
+          nb++;
+     }
+     /* end of file not seen yet, ask for everything after what we got */
+     if ((last < 0) && (nb < max) && (max_block < 65535))
+     {
+          ranges[2 * nb] = max_block + 1;
+          ranges[2 * nb + 1] = 65535;
+          nb++;
+     }
+     return nb;
+}
 
 /*
  * Receive a file. This is implemented as a state machine using a while loop
@@ -137,6 +170,10 @@ int tftp_receive_file(struct client_data *data)
      struct sockaddr_storage sa_mcast;
      union ip_mreq_storage mreq;
      int master_client = 0;
+     int repair = 0;            /* multicast repair mode, see tftpd_file.c */
+     unsigned short *ranges = NULL; /* missing blocks reported in repair mode */
+     int nb_ranges;
+     long max_block = 0;        /* highest block received in repair mode */
      unsigned int file_bitmap[NB_BLOCK];
      int prev_bitmap_hole = -1; /* the previous hole found in the bitmap */
      char string[MAXLEN];
@@ -241,6 +278,23 @@ int tftp_receive_file(struct client_data *data)
                          tftp_find_bitmap_hole(prev_bitmap_hole, file_bitmap);
                     block_number = prev_bitmap_hole;
                }
+               if (repair && (block_number != last_block_number))
+               {
+                    /* report every missing block, not only the first one */
+                    nb_ranges = tftp_find_bitmap_ranges(block_number,
+                                                        last_block_number,
+                                                        max_block, file_bitmap,
+                                                        ranges,
+                                                        (data->data_buffer_size - 4) / 4);
+                    if (data->trace)
+                         fprintf(stderr, "sent report <block: %ld, ranges: %d>\n",
+                                 block_number, nb_ranges);
+                    tftp_send_report(sockfd, &sa, block_number, ranges,
+                                     nb_ranges, data->data_buffer,
+                                     data->data_buffer_size);
+                    state = S_WAIT_PACKET;
+                    break;
+               }
                if (data->trace)
                     fprintf(stderr, "sent ACK <block: %ld>\n", block_number);
                tftp_send_ack(sockfd, &sa, block_number);
@@ -490,6 +544,25 @@ int tftp_receive_file(struct client_data *data)
                               exit(1);
 			 }
 
+                         /* many clients of the same group may run on
+                            this host */
+                         err = 1;
+                         setsockopt(mcast_sockfd, SOL_SOCKET, SO_REUSEADDR,
+                                    &err, sizeof(err));
+                         /* and only receive the group we join, not the
+                            ones joined by other sockets on that port */
+                         err = 0;
+#ifdef IP_MULTICAST_ALL
+                         if (sa_mcast_group.ss_family == AF_INET)
+                              setsockopt(mcast_sockfd, IPPROTO_IP,
+                                         IP_MULTICAST_ALL, &err, sizeof(err));
+#endif
+#ifdef IPV6_MULTICAST_ALL
+                         if (sa_mcast_group.ss_family == AF_INET6)
+                              setsockopt(mcast_sockfd, IPPROTO_IPV6,
+                                         IPV6_MULTICAST_ALL, &err, sizeof(err));
+#endif
+
                          memset(&sa_mcast, 0, sizeof(sa_mcast));
                          sa_mcast.ss_family = sa_mcast_group.ss_family;
                          sockaddr_set_port(&sa_mcast, mc_port);
@@ -517,16 +590,46 @@ int tftp_receive_file(struct client_data *data)
                          }
                          multicast = 1;
                     }
+                    /* repair: the server streams the file, we only report
+                       missing blocks when it sends the last one */
+                    if (multicast &&
+                        data->tftp_options_reply[OPT_REPAIR].specified)
+                    {
+                         if (data->trace)
+                              fprintf(stderr, "repair, ");
+                         if ((ranges = malloc(data->data_buffer_size)) == NULL)
+                         {
+                              fprintf(stderr,
+                                      "tftp: memory allocation failure.\n");
+                              exit(1);
+                         }
+                         repair = 1;
+                    }
                }
                if (data->trace)
                     fprintf(stderr, "\b\b>\n");
-               if ((multicast && master_client) || (!multicast))
+               if (repair)
+               {
+                    timeout_state = S_SEND_ACK;
+                    state = S_WAIT_PACKET;
+               }
+               else if ((multicast && master_client) || (!multicast))
                     state = S_SEND_ACK;
                else
                     state = S_WAIT_PACKET;
                break;
           case S_DATA_RECEIVED:
-               if ((multicast && master_client) || (!multicast))
+#if DEBUG
+               if (data->drop && ((rand() % 100) < data->drop))
+               {
+                    if (data->trace)
+                         fprintf(stderr, "dropped DATA <block: %d>\n",
+                                 ntohs(tftphdr->th_block));
+                    state = S_WAIT_PACKET;
+                    break;
+               }
+#endif
+               if (repair || (multicast && master_client) || (!multicast))
                     timeout_state = S_SEND_ACK;
                else
                     timeout_state = S_WAIT_PACKET;
@@ -564,9 +667,19 @@ int tftp_receive_file(struct client_data *data)
                     /* Mark the received block in the bitmap */
                     file_bitmap[(block_number - 1)/32]
                          |= (1 << ((block_number - 1) % 32));
-                    /* if we are the master client we ack, else
-                       we just wait for data */
-                    if (master_client || !multicast)
+                    if (block_number > max_block)
+                         max_block = block_number;
+                    /* in repair mode, the last block ends a round. If we
+                       are the master client we ack, else we just wait for
+                       data */
+                    if (repair)
+                    {
+                         if (block_number == last_block_number)
+                              state = S_SEND_ACK;
+                         else
+                              state = S_WAIT_PACKET;
+                    }
+                    else if (master_client || !multicast)
                          state = S_SEND_ACK;
                     else
                          state = S_WAIT_PACKET;
@@ -596,6 +709,8 @@ int tftp_receive_file(struct client_data *data)
                          exit(1);
                     }
                }
+               if (ranges)
+                    free(ranges);
                /* close multicast socket */
                if (mcast_sockfd)
                     close(mcast_sockfd);
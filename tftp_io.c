@@ -112,6 +112,44 @@ int tftp_send_ack(int socket, struct sockaddr_storage *sa, long block_number)
      return OK;
 }
 
+/*
+ * Report of missing blocks, used by multicast repair mode. This is an ACK
+ * followed by ranges of missing blocks (first and last inclusive). Block #
+ * has the usual meaning: all blocks up to it are received.
+ *
+ *  2 bytes   2 bytes   2 bytes   2 bytes           2 bytes   2 bytes
+ * --------------------------------------------------------------------
+ *| Opcode  | Block # | First 1 | Last 1  |  ...  | First N | Last N  |
+ * --------------------------------------------------------------------
+ */
+int tftp_send_report(int socket, struct sockaddr_storage *sa, long block_number,
+                     unsigned short *ranges, int nb_ranges, char *buffer,
+                     int buffer_size)
+{
+     struct tftphdr *tftphdr = (struct tftphdr *)buffer;
+     unsigned short *range = (unsigned short *)(buffer + 4);
+     int size = 4;
+     int i;
+     int result;
+
+     tftphdr->th_opcode = htons(ACK);
+     tftphdr->th_block = htons((short)block_number);
+
+     for (i = 0; (i < 2 * nb_ranges) && (size + 2 <= buffer_size); i++)
+     {
+          range[i] = htons(ranges[i]);
+          size += 2;
+     }
+     /* never send half a range */
+     size -= (size - 4) % 4;
+
+     result = sendto(socket, buffer, size, 0, (struct sockaddr *)sa,
+                     sizeof(*sa));
+     if (result < 0)
+          return ERR;
+     return OK;
+}
+
 /*
  *  2 bytes   string  1 byte  string  1 byte  string  1 byte   string  1 byte
  * ---------------------------------------------------------------------------
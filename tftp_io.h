@@ -43,6 +43,9 @@ int tftp_send_request(int socket, struct sockaddr_storage *s_inn, short type,
                       char *data_buffer, int data_buffer_size,
                       struct tftp_opt *tftp_options);
 int tftp_send_ack(int socket, struct sockaddr_storage *s_inn, long block_number);
+int tftp_send_report(int socket, struct sockaddr_storage *s_inn, long block_number,
+                     unsigned short *ranges, int nb_ranges, char *buffer,
+                     int buffer_size);
 int tftp_send_oack(int socket, struct sockaddr_storage *s_inn, struct tftp_opt *tftp_options,
                    char *buffer, int buffer_size);
 int tftp_send_error(int socket, struct sockaddr_storage *s_inn, short err_code,
@@ -42,6 +42,7 @@
 #include "logger.h"
 #include "options.h"
 #include "stats.h"
+#include "tftpd_cache.h"
 #ifdef HAVE_PCRE
 #include "tftpd_pcre.h"
 #endif
@@ -109,8 +110,24 @@ int source_port_checking = 1;
    the current client timeout in multicast mode */
 int mcast_switch_client = 0;
 
+/* Multicast repair mode */
+int mcast_repair = 0;
+
+/* Pacing of multicast DATA per session and for all sessions, in bytes
+   and packets per second */
+int mcast_rate = 0;
+int mcast_pps = 0;
+int mcast_total_rate = 0;
+int mcast_total_pps = 0;
+
+/* Maximum number of clients in a multicast session, 0 is unlimited */
+int mcast_max_clients = 0;
+
 int trace = 0;
 
+/* keep file metadata in memory, see tftpd_cache.c */
+int stat_cache = 0;
+
 #ifdef HAVE_PCRE
 /* Use for PCRE file name substitution */
 tftpd_pcre_self_t *pcre_top = NULL;
@@ -389,6 +406,19 @@ int main(int argc, char **argv)
      /* start collecting stats */
      stats_start();
 
+     /* pacing shared by all multicast transfers */
+     tftpd_pacer_init(&tftpd_global_pacer, mcast_total_rate, mcast_total_pps);
+
+     /* start watching the served directory */
+     if (stat_cache)
+     {
+          if (tftpd_cache_init() != OK)
+          {
+               logger(LOG_WARNING, "Failed to start stat cache, continuing anyway.");
+               stat_cache = 0;
+          }
+     }
+
 #ifdef HAVE_MTFTP
      /* start mtftp server thread */
      if (strlen(mtftp_file) > 0)
@@ -406,6 +436,8 @@ int main(int argc, char **argv)
                     mtftp_data->timeout = retry_timeout;
                     mtftp_data->checkport = source_port_checking;
                     mtftp_data->trace = trace;
+                    mtftp_data->mcast_rate = mcast_rate;
+                    mtftp_data->mcast_pps = mcast_pps;
                     /* Start server thread. */
                     if (pthread_create(&mtftp_thread, NULL, tftpd_mtftp_server,
                                        (void *)mtftp_data) != 0)
@@ -527,6 +559,9 @@ int main(int argc, char **argv)
 
                /* other options */
                new->mcast_switch_client = mcast_switch_client;
+               new->mcast_rate = mcast_rate;
+               new->mcast_pps = mcast_pps;
+               new->mcast_max_clients = mcast_max_clients;
                new->trace = trace;
 
                /* default ttl for multicast */
@@ -597,6 +632,13 @@ int main(int argc, char **argv)
      /* stop collecting stats and print them*/
      stats_end();
      stats_print();
+     if (tftp_default_options[OPT_MULTICAST].enabled)
+          tftpd_mcast_print();
+     if (stat_cache)
+     {
+          tftpd_cache_print();
+          tftpd_cache_close();
+     }
 
 #ifdef HAVE_PCRE
      /* remove allocated memory for tftpd_pcre */
@@ -605,6 +647,7 @@ int main(int argc, char **argv)
 #endif
 
      /* some cleaning */
+     tftpd_mcast_clean();
      if (log_file)
           free(log_file);
 #ifdef HAVE_PCRE
@@ -848,7 +891,7 @@ void *tftpd_receive_request(void *arg)
 
      /* if the thread had reserverd a multicast IP/Port, deallocate it */
      if (data->mc_port != 0)
-          tftpd_mcast_free_tid(data->mc_addr, data->mc_port);
+          tftpd_mcast_free_tid(data->mc_tid);
 
      /* this function take care of freeing allocated memory by other threads */
      tftpd_clientlist_free(data);
@@ -907,6 +950,13 @@ void signal_handler(int signal)
 #define OPT_MTFTP      '7'
 #define OPT_MTFTP_PORT '8'
 #define OPT_TRACE      '9'
+#define OPT_STAT_CACHE 'a'
+#define OPT_MCAST_REPAIR 'b'
+#define OPT_MCAST_RATE 'c'
+#define OPT_MCAST_MAX  'd'
+#define OPT_MCAST_PPS  'e'
+#define OPT_MCAST_TOTAL_RATE 'f'
+#define OPT_MCAST_TOTAL_PPS 'g'
 
 /*
  * Parse the command line using the standard getopt function.
@@ -957,6 +1007,13 @@ int tftpd_cmd_line_options(int argc, char **argv)
           { "prevent-sas", 0, NULL, 'X' },
           { "no-source-port-checking", 0, NULL, OPT_PORT_CHECK },
           { "mcast-switch-client", 0, NULL, OPT_MCAST_SWITCH },
+          { "stat-cache", 0, NULL, OPT_STAT_CACHE },
+          { "mcast-repair", 0, NULL, OPT_MCAST_REPAIR },
+          { "mcast-rate", 1, NULL, OPT_MCAST_RATE },
+          { "mcast-max-clients", 1, NULL, OPT_MCAST_MAX },
+          { "mcast-pps", 1, NULL, OPT_MCAST_PPS },
+          { "mcast-total-rate", 1, NULL, OPT_MCAST_TOTAL_RATE },
+          { "mcast-total-pps", 1, NULL, OPT_MCAST_TOTAL_PPS },
           { "version", 0, NULL, 'V' },
           { "help", 0, NULL, 'h' },
           { 0, 0, 0, 0 }
@@ -1097,6 +1154,37 @@ int tftpd_cmd_line_options(int argc, char **argv)
           case OPT_MCAST_SWITCH:
                mcast_switch_client = 1;
                break;
+          case OPT_STAT_CACHE:
+               stat_cache = 1;
+               break;
+          case OPT_MCAST_REPAIR:
+               mcast_repair = 1;
+               break;
+          case OPT_MCAST_RATE:
+               mcast_rate = atoi(optarg);
+               if (mcast_rate < 0)
+                    mcast_rate = 0;
+               break;
+          case OPT_MCAST_MAX:
+               mcast_max_clients = atoi(optarg);
+               if (mcast_max_clients < 0)
+                    mcast_max_clients = 0;
+               break;
+          case OPT_MCAST_PPS:
+               mcast_pps = atoi(optarg);
+               if (mcast_pps < 0)
+                    mcast_pps = 0;
+               break;
+          case OPT_MCAST_TOTAL_RATE:
+               mcast_total_rate = atoi(optarg);
+               if (mcast_total_rate < 0)
+                    mcast_total_rate = 0;
+               break;
+          case OPT_MCAST_TOTAL_PPS:
+               mcast_total_pps = atoi(optarg);
+               if (mcast_total_pps < 0)
+                    mcast_total_pps = 0;
+               break;
 #ifdef HAVE_MTFTP
           case OPT_MTFTP:
                Strncpy(mtftp_file, optarg, MAXLEN);
@@ -1123,6 +1211,8 @@ int tftpd_cmd_line_options(int argc, char **argv)
      /* make sure the last caracter is a / */
      if (directory[strlen(directory)] != '/')
           strcat(directory, "/");
+     /* repair option is only negotiated when turned on */
+     tftp_default_options[OPT_REPAIR].enabled = mcast_repair;
      /* build multicast address/port range */
      if (tftpd_mcast_parse_opt(mcast_addr, mcast_port) != OK)
      {
@@ -1179,6 +1269,14 @@ void tftpd_log_options(void)
             tftp_default_options[OPT_MULTICAST].enabled ? "enabled":"disabled");
      logger(LOG_INFO, "     address range: %s", mcast_addr);
      logger(LOG_INFO, "     port range:    %s", mcast_port);
+     if (mcast_max_clients > 0)
+          logger(LOG_INFO, "     max clients:   %d", mcast_max_clients);
+     if (mcast_rate || mcast_pps)
+          logger(LOG_INFO, "     session rate:  %d bytes/s, %d packets/s",
+                 mcast_rate, mcast_pps);
+     if (mcast_total_rate || mcast_total_pps)
+          logger(LOG_INFO, "     total rate:    %d bytes/s, %d packets/s",
+                 mcast_total_rate, mcast_total_pps);
 #ifdef HAVE_PCRE
      if (pcre_top)
           logger(LOG_INFO, "  PCRE: using file: %s", pcre_file);
@@ -1194,6 +1292,10 @@ void tftpd_log_options(void)
           logger(LOG_INFO, "  --mcast-switch-client turned on");
      if (!source_port_checking)
           logger(LOG_INFO, "  --no-source-port-checking turned on");
+     if (stat_cache)
+          logger(LOG_INFO, "  --stat-cache turned on");
+     if (mcast_repair)
+          logger(LOG_INFO, "  --mcast-repair turned on");
 }
 
 /*
@@ -1280,6 +1382,15 @@ void tftpd_usage(void)
 #endif
             "  --no-source-port-checking  : violate RFC, see man page\n"
             "  --mcast-switch-client      : switch client on first timeout, see man page\n"
+            "  --stat-cache               : keep file metadata in memory, see man page\n"
+            "  --mcast-repair             : stream multicast files and repair holes\n"
+            "                               reported by clients, see man page\n"
+            "  --mcast-rate <bytes/s>     : sending rate of a multicast session\n"
+            "  --mcast-pps <packets/s>    : same in packets per second\n"
+            "  --mcast-total-rate <bytes/s>: sending rate of all multicast sessions\n"
+            "  --mcast-total-pps <packets/s>: same in packets per second\n"
+            "  --mcast-max-clients <value>: number of clients per multicast\n"
+            "                               session, start a new one when full\n"
             "  -V, --version              : print version information\n"
             "  -h, --help                 : print this help\n"
             "\n"
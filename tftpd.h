@@ -22,6 +22,7 @@
 #include <arpa/inet.h>
 #include <sys/types.h>
 #include "tftp_io.h"
+#include "tftpd_pacer.h"
 
 /*
  * Per thread data. There is a thread for each client or group
@@ -43,11 +44,16 @@ struct thread_data {
      int sockfd;
 
      /* multicast stuff */
+     int mc_tid;                /* index of mc_addr/mc_port */
      short mc_port;             /* multicast port */
      char *mc_addr;             /* multicast address */
      struct sockaddr_storage sa_mcast;
      union ip_mreq_storage mcastaddr;
      u_char mcast_ttl;
+     int mcast_rate;            /* bytes per second, 0 is unlimited */
+     int mcast_pps;             /* packets per second, 0 is unlimited */
+     struct tftpd_pacer pacer;  /* paces DATA sent to the group */
+     int mcast_max_clients;     /* clients per session, 0 is unlimited */
      
      /*
       * Self can read/write until client_ready is set. Then only allowed to read.
@@ -59,9 +65,18 @@ struct thread_data {
      /* 
       * Must lock to insert in the list or search, but not to read or write 
       * in the client_info structure, since only the propriotary thread do it.
+      * client_info is the current (master) client. Clients not done are
+      * indexed by address in client_hash and linked in a ring walked
+      * round robin. Done clients are freed, except the master which is
+      * freed when the next one takes its place.
       */
      pthread_mutex_t client_mutex;
      struct client_info *client_info;
+     struct client_info **client_hash; /* allocated when ready */
+     struct client_info *client_ring; /* next client to serve */
+     int client_count;          /* number of clients not done */
+     int report_round;          /* repair round of client_reported */
+     int client_reported;       /* clients that reported in report_round */
      int client_ready;        /* one if other thread may add client */
  
      /* must be lock (list lock) to update */
@@ -69,9 +84,14 @@ struct thread_data {
      struct thread_data *next;
 };
 
+#define CLIENT_HASH_SIZE 256   /* per multicast thread, power of 2 */
+
 struct client_info {
      struct sockaddr_storage client;
      int done;                  /* that client as receive it's file */
+     int round;                 /* last repair round it reported in */
+     struct client_info *hnext; /* next in hash bucket */
+     struct client_info *prev;  /* ring of clients not done */
      struct client_info *next;
 };
 
@@ -103,13 +123,19 @@ int tftpd_clientlist_done(struct thread_data *thread,
                           struct sockaddr_storage *sock);
 int tftpd_clientlist_next(struct thread_data *thread,
                           struct client_info **client);
+int tftpd_clientlist_report(struct thread_data *thread,
+                            struct sockaddr_storage *sock, int round);
+int tftpd_clientlist_pending(struct thread_data *thread, int round);
+int tftpd_clientlist_active(struct thread_data *thread);
 void tftpd_list_kill_threads(void);
 
 /*
  * Defines in tftpd_mcast.c
  */
-int tftpd_mcast_get_tid(char **addr, short *port);
-int tftpd_mcast_free_tid(char *addr, short port);
+int tftpd_mcast_get_tid(int *tid, char **addr, short *port);
+int tftpd_mcast_free_tid(int tid);
 int tftpd_mcast_parse_opt(char *addr, char *ports);
+void tftpd_mcast_print(void);
+void tftpd_mcast_clean(void);
 
 #endif
@@ -0,0 +1,486 @@
+/* hey emacs! -*- Mode: C; c-file-style: "k&r"; indent-tabs-mode: nil -*- */
+/*
+ * tftpd_cache.c
+ *    in memory index of file metadata, kept current by inotify
+ *
+ * $Id$
+ *
+ * Copyright (c) 2000 Jean-Pierre Lefebvre <helix@step.polymtl.ca>
+ *                and Remi Lefebvre <remi@debian.org>
+ *
+ * atftp is free software; you can redistribute them and/or modify them
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#ifdef HAVE_SYS_INOTIFY_H
+#include <sys/inotify.h>
+#endif
+#include "tftpd_cache.h"
+#include "logger.h"
+
+/*
+ * The index is filled lazily: the first lookup of a file stat() it and
+ * add a watch on its parent directory. From then on, the entry is only
+ * dropped when inotify reports a change in that directory. When the
+ * kernel event queue overflows, we can't know what changed so the whole
+ * index is flushed and rebuilt by the following lookups.
+ *
+ * Symbolic links are never cached since a change of their target is not
+ * reported by the watch on the link's directory.
+ *
+ * The hash table and the watch list are protected by cache_lock. Lookups
+ * take it for reading. cache_generation is incremented each time entries
+ * are dropped, so a lookup racing with an event does not insert stale
+ * information.
+ */
+#ifdef HAVE_SYS_INOTIFY_H
+
+#define CACHE_EVENT_MASK (IN_ATTRIB | IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | \
+                          IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                          IN_DELETE_SELF | IN_MOVE_SELF)
+
+static struct cache_entry *cache_table[CACHE_HASH_SIZE];
+static struct cache_watch *cache_watch = NULL;
+static pthread_rwlock_t cache_lock = PTHREAD_RWLOCK_INITIALIZER;
+static unsigned long cache_generation = 0;
+
+static int inotify_fd = -1;
+static int cache_pipe[2] = { -1, -1 }; /* used to stop the thread */
+static pthread_t cache_thread;
+#endif
+
+static int cache_enabled = 0;
+static struct cache_stats c_stats = { PTHREAD_MUTEX_INITIALIZER };
+
+#ifdef HAVE_SYS_INOTIFY_H
+/*
+ * FNV-1a hash of the file name.
+ */
+static unsigned int cache_hash(const char *path)
+{
+     unsigned int hash = 2166136261U;
+
+     while (*path)
+     {
+          hash ^= (unsigned char)*path++;
+          hash *= 16777619U;
+     }
+     return hash;
+}
+
+/*
+ * Remove "//" and "/./" from the file name, so a file has only one
+ * name in the index.
+ */
+static void cache_normalize(char *to, const char *from, size_t size)
+{
+     char *end = to + size - 1;
+
+     while (*from && (to < end))
+     {
+          if ((*from == '/') && (from[1] == '/'))
+               from++;
+          else if ((*from == '/') && (from[1] == '.') && (from[2] == '/'))
+               from += 2;
+          else
+               *to++ = *from++;
+     }
+     *to = '\0';
+}
+
+/*
+ * Find an entry, cache_lock must be held.
+ */
+static struct cache_entry *cache_find(const char *path, unsigned int hash)
+{
+     struct cache_entry *entry = cache_table[hash & (CACHE_HASH_SIZE - 1)];
+
+     while (entry)
+     {
+          if ((entry->hash == hash) && (strcmp(entry->path, path) == 0))
+               return entry;
+          entry = entry->next;
+     }
+     return NULL;
+}
+
+/*
+ * Drop every entry of the index. cache_lock must be held for writing.
+ */
+static int cache_flush_locked(void)
+{
+     int i;
+     int count = 0;
+     struct cache_entry *entry;
+
+     for (i = 0; i < CACHE_HASH_SIZE; i++)
+     {
+          while ((entry = cache_table[i]) != NULL)
+          {
+               cache_table[i] = entry->next;
+               free(entry->path);
+               free(entry);
+               count++;
+          }
+     }
+     cache_generation++;
+     return count;
+}
+
+/*
+ * Drop the entry of a single file. cache_lock must be held for writing.
+ */
+static int cache_invalidate_locked(const char *path)
+{
+     unsigned int hash = cache_hash(path);
+     struct cache_entry **prev = &cache_table[hash & (CACHE_HASH_SIZE - 1)];
+     struct cache_entry *entry;
+
+     cache_generation++;
+     while ((entry = *prev) != NULL)
+     {
+          if ((entry->hash == hash) && (strcmp(entry->path, path) == 0))
+          {
+               *prev = entry->next;
+               free(entry->path);
+               free(entry);
+               return 1;
+          }
+          prev = &entry->next;
+     }
+     return 0;
+}
+
+/*
+ * Make sure the directory holding path is watched. cache_lock must be
+ * held for writing. Return OK if the directory is watched.
+ */
+static int cache_watch_locked(const char *path)
+{
+     char dir[MAXLEN];
+     char *tmp;
+     int wd;
+     struct cache_watch *watch;
+
+     /* keep the trailing '/' so dir + name give back the path */
+     Strncpy(dir, path, sizeof(dir));
+     if ((tmp = strrchr(dir, '/')) == NULL)
+          return ERR;
+     *(tmp + 1) = '\0';
+
+     if ((wd = inotify_add_watch(inotify_fd, dir, CACHE_EVENT_MASK)) < 0)
+     {
+          if ((errno != ENOENT) && (errno != ENOTDIR))
+               logger(LOG_WARNING, "inotify_add_watch: %s: %s", dir,
+                      strerror(errno));
+          return ERR;
+     }
+     /* inotify return the same descriptor for a directory already watched */
+     for (watch = cache_watch; watch != NULL; watch = watch->next)
+     {
+          if (watch->wd == wd)
+               return OK;
+     }
+     if ((watch = malloc(sizeof(struct cache_watch))) == NULL)
+          return ERR;
+     if ((watch->dir = strdup(dir)) == NULL)
+     {
+          free(watch);
+          return ERR;
+     }
+     watch->wd = wd;
+     watch->next = cache_watch;
+     cache_watch = watch;
+     logger(LOG_DEBUG, "stat cache: watching %s", dir);
+     return OK;
+}
+
+/*
+ * Apply one inotify event to the index. cache_lock must be held for
+ * writing. Return the number of entries dropped.
+ */
+static int cache_event_locked(struct inotify_event *event)
+{
+     char path[MAXLEN];
+     struct cache_watch *watch;
+     struct cache_watch **prev;
+
+     /* A directory was moved or removed, entries bellow it can't be
+        found from here. */
+     if ((event->mask & (IN_ISDIR | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) ||
+         (event->len == 0))
+     {
+          if (event->mask & IN_IGNORED)
+          {
+               for (prev = &cache_watch; (watch = *prev) != NULL;
+                    prev = &watch->next)
+               {
+                    if (watch->wd == event->wd)
+                    {
+                         *prev = watch->next;
+                         free(watch->dir);
+                         free(watch);
+                         break;
+                    }
+               }
+          }
+          return cache_flush_locked();
+     }
+
+     for (watch = cache_watch; watch != NULL; watch = watch->next)
+     {
+          if (watch->wd == event->wd)
+          {
+               snprintf(path, sizeof(path), "%s%s", watch->dir, event->name);
+               return cache_invalidate_locked(path);
+          }
+     }
+     return 0;
+}
+
+/*
+ * Thread reading inotify events until tftpd_cache_close() write to
+ * the pipe.
+ */
+static void *tftpd_cache_thread(void *arg)
+{
+     char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+     struct inotify_event *event;
+     fd_set rfds;
+     ssize_t len;
+     char *ptr;
+     int count;
+     int maxfd = (inotify_fd > cache_pipe[0]) ? inotify_fd : cache_pipe[0];
+
+     while (1)
+     {
+          FD_ZERO(&rfds);
+          FD_SET(inotify_fd, &rfds);
+          FD_SET(cache_pipe[0], &rfds);
+          if (select(maxfd + 1, &rfds, NULL, NULL, NULL) < 0)
+          {
+               if (errno == EINTR)
+                    continue;
+               logger(LOG_ERR, "%s: %d: select: %s",
+                      __FILE__, __LINE__, strerror(errno));
+               break;
+          }
+          if (FD_ISSET(cache_pipe[0], &rfds))
+               break;
+          if ((len = read(inotify_fd, buf, sizeof(buf))) <= 0)
+               continue;
+
+          count = 0;
+          pthread_rwlock_wrlock(&cache_lock);
+          for (ptr = buf; ptr < buf + len;
+               ptr += sizeof(struct inotify_event) + event->len)
+          {
+               event = (struct inotify_event *)ptr;
+               if (event->mask & IN_Q_OVERFLOW)
+               {
+                    logger(LOG_NOTICE, "stat cache: inotify queue overflow, flushing");
+                    count += cache_flush_locked();
+                    pthread_mutex_lock(&c_stats.mutex);
+                    c_stats.flushes++;
+                    pthread_mutex_unlock(&c_stats.mutex);
+               }
+               else
+                    count += cache_event_locked(event);
+          }
+          pthread_rwlock_unlock(&cache_lock);
+
+          if (count)
+          {
+               pthread_mutex_lock(&c_stats.mutex);
+               c_stats.entries -= count;
+               c_stats.invalidations += count;
+               pthread_mutex_unlock(&c_stats.mutex);
+          }
+     }
+     return NULL;
+}
+#endif
+
+/*
+ * Start the inotify thread. When not supported, tftpd_cache_stat()
+ * simply call stat().
+ */
+int tftpd_cache_init(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+     if ((inotify_fd = inotify_init()) < 0)
+     {
+          logger(LOG_ERR, "inotify_init: %s", strerror(errno));
+          return ERR;
+     }
+     if (pipe(cache_pipe) < 0)
+     {
+          logger(LOG_ERR, "pipe: %s", strerror(errno));
+          close(inotify_fd);
+          return ERR;
+     }
+     if (pthread_create(&cache_thread, NULL, tftpd_cache_thread, NULL) != 0)
+     {
+          logger(LOG_ERR, "Failed to start stat cache thread");
+          close(inotify_fd);
+          close(cache_pipe[0]);
+          close(cache_pipe[1]);
+          return ERR;
+     }
+     cache_enabled = 1;
+     return OK;
+#else
+     logger(LOG_WARNING, "stat cache needs inotify support");
+     return ERR;
+#endif
+}
+
+/*
+ * Fill st with the metadata of filename. Return OK if the file exists,
+ * ERR if not.
+ */
+int tftpd_cache_stat(char *filename, struct stat *st)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+     char path[MAXLEN];
+     unsigned int hash;
+     unsigned long generation;
+     struct cache_entry *entry;
+     int watched;
+     int result;
+     int negative;
+#endif
+
+     if (!cache_enabled)
+          return (stat(filename, st) == 0) ? OK : ERR;
+
+#ifdef HAVE_SYS_INOTIFY_H
+     cache_normalize(path, filename, sizeof(path));
+     filename = path;
+     hash = cache_hash(filename);
+
+     pthread_rwlock_rdlock(&cache_lock);
+     if ((entry = cache_find(filename, hash)) != NULL)
+     {
+          negative = entry->negative;
+          if (!negative)
+               memcpy(st, &entry->st, sizeof(struct stat));
+          pthread_rwlock_unlock(&cache_lock);
+
+          pthread_mutex_lock(&c_stats.mutex);
+          c_stats.hits++;
+          pthread_mutex_unlock(&c_stats.mutex);
+          return negative ? ERR : OK;
+     }
+     pthread_rwlock_unlock(&cache_lock);
+
+     /* the watch must be in place before looking at the file, or a change
+        in between would be missed */
+     pthread_rwlock_wrlock(&cache_lock);
+     watched = cache_watch_locked(filename);
+     generation = cache_generation;
+     pthread_rwlock_unlock(&cache_lock);
+
+     result = lstat(filename, st);
+     negative = (result < 0);
+     if (negative && (errno != ENOENT) && (errno != ENOTDIR))
+          watched = ERR;
+     if (!negative && S_ISLNK(st->st_mode))
+     {
+          watched = ERR;
+          result = stat(filename, st);
+     }
+
+     pthread_mutex_lock(&c_stats.mutex);
+     c_stats.misses++;
+     pthread_mutex_unlock(&c_stats.mutex);
+
+     if (watched != OK)
+          return (result == 0) ? OK : ERR;
+
+     pthread_rwlock_wrlock(&cache_lock);
+     if ((generation == cache_generation) &&
+         (cache_find(filename, hash) == NULL) &&
+         ((entry = calloc(1, sizeof(struct cache_entry))) != NULL))
+     {
+          if ((entry->path = strdup(filename)) == NULL)
+               free(entry);
+          else
+          {
+               entry->hash = hash;
+               entry->negative = negative;
+               if (!negative)
+                    memcpy(&entry->st, st, sizeof(struct stat));
+               entry->next = cache_table[hash & (CACHE_HASH_SIZE - 1)];
+               cache_table[hash & (CACHE_HASH_SIZE - 1)] = entry;
+
+               pthread_mutex_lock(&c_stats.mutex);
+               if (++c_stats.entries > CACHE_MAX_ENTRIES)
+                    c_stats.entries -= cache_flush_locked();
+               pthread_mutex_unlock(&c_stats.mutex);
+          }
+     }
+     pthread_rwlock_unlock(&cache_lock);
+
+     return (result == 0) ? OK : ERR;
+#endif
+}
+
+/*
+ * Called at the end of the main thread to print counters.
+ */
+void tftpd_cache_print(void)
+{
+     if (!cache_enabled)
+          return;
+     logger(LOG_INFO, "  Stat cache:");
+     logger(LOG_INFO, "   entries:       %d", c_stats.entries);
+     logger(LOG_INFO, "   hits:          %d", c_stats.hits);
+     logger(LOG_INFO, "   misses:        %d", c_stats.misses);
+     logger(LOG_INFO, "   invalidations: %d", c_stats.invalidations);
+     logger(LOG_INFO, "   flushes:       %d", c_stats.flushes);
+}
+
+/*
+ * Stop the inotify thread and release memory.
+ */
+void tftpd_cache_close(void)
+{
+#ifdef HAVE_SYS_INOTIFY_H
+     struct cache_watch *watch;
+
+     if (!cache_enabled)
+          return;
+     if (write(cache_pipe[1], "", 1) == 1)
+          pthread_join(cache_thread, NULL);
+     cache_enabled = 0;
+
+     pthread_rwlock_wrlock(&cache_lock);
+     cache_flush_locked();
+     while ((watch = cache_watch) != NULL)
+     {
+          cache_watch = watch->next;
+          free(watch->dir);
+          free(watch);
+     }
+     pthread_rwlock_unlock(&cache_lock);
+
+     close(inotify_fd);
+     close(cache_pipe[0]);
+     close(cache_pipe[1]);
+#endif
+}
@@ -0,0 +1,65 @@
+/* hey emacs! -*- Mode: C; c-file-style: "k&r"; indent-tabs-mode: nil -*- */
+/*
+ * tftpd_cache.h
+ *
+ * $Id$
+ *
+ * Copyright (c) 2000 Jean-Pierre Lefebvre <helix@step.polymtl.ca>
+ *                and Remi Lefebvre <remi@debian.org>
+ *
+ * atftp is free software; you can redistribute them and/or modify them
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifndef tftpd_cache_h
+#define tftpd_cache_h
+
+#include <pthread.h>
+#include <sys/stat.h>
+#include "tftp_def.h"
+
+#define CACHE_HASH_SIZE   4096  /* number of buckets, power of 2 */
+#define CACHE_MAX_ENTRIES 65536 /* index is flushed when reached */
+
+/*
+ * One entry of the metadata index. A negative entry records a file
+ * known not to exist.
+ */
+struct cache_entry {
+     char *path;
+     unsigned int hash;
+     int negative;
+     struct stat st;
+     struct cache_entry *next;
+};
+
+/*
+ * Directories watched by inotify, the watch descriptor is used to
+ * rebuild the full path of a changed file.
+ */
+struct cache_watch {
+     int wd;
+     char *dir;
+     struct cache_watch *next;
+};
+
+/* counters, printed at exit */
+struct cache_stats {
+     pthread_mutex_t mutex;
+     int entries;               /* current size of the index */
+     int hits;
+     int misses;
+     int invalidations;         /* entries dropped on inotify events */
+     int flushes;               /* full rescan after queue overflow */
+};
+
+/* Functions defined in tftpd_cache.c */
+int tftpd_cache_init(void);
+int tftpd_cache_stat(char *filename, struct stat *st);
+void tftpd_cache_print(void);
+void tftpd_cache_close(void);
+
+#endif
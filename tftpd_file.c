@@ -33,6 +33,7 @@
 #include "tftp_def.h"
 #include "logger.h"
 #include "options.h"
+#include "tftpd_cache.h"
 #ifdef HAVE_PCRE
 #include "tftpd_pcre.h"
 #endif
@@ -50,6 +51,8 @@
 #define S_ABORT         10
 #define S_END           11
 
+#define REPAIR_WAIT     1       /* seconds without report ending a round */
+
 
 /* read only variables unless for the main thread, at initialisation */
 extern char directory[MAXLEN];
@@ -90,6 +93,176 @@ int tftpd_rules_check(char *filename)
      return OK;
 }
 
+/*
+ * Multicast repair mode. Instead of following the ACKs of a master client,
+ * the file is streamed to the group as fast as the pacers allow. At the end of a round,
+ * clients send a report of their missing blocks (see tftp_send_report).
+ * Reports are merged in a bitmap and only the union of the holes is sent
+ * in the next round. The last block is sent at the end of every round so
+ * clients know when to report. A client is done when it ACK the last block.
+ */
+static int tftpd_send_repair(struct thread_data *data, FILE *fp,
+                             long last_block)
+{
+     struct sockaddr_storage *sa = &data->client_info->client;
+     struct sockaddr_storage from;
+     char addr_str[SOCKADDR_PRINT_ADDR_LEN];
+     char string[MAXLEN];
+     struct tftphdr *tftphdr = (struct tftphdr *)data->data_buffer;
+     unsigned short *range;
+     unsigned int *bitmap;
+     int sockfd = data->sockfd;
+     int block_size = data->data_buffer_size - 4;
+     long block_number;
+     long first;
+     long end;
+     int data_size;
+     int result;
+     int i;
+     int round = 0;
+     int silent;
+     int number_of_timeout = 0;
+     long sent = 0;
+     long prev_block_number = 0;
+     long prev_file_pos = 0;
+     int temp = 0;
+
+     /* one bit per block, bit 0 is unused */
+     if ((bitmap = calloc(last_block / 32 + 1, sizeof(unsigned int))) == NULL)
+     {
+          logger(LOG_ERR, "memory allocation failure");
+          return ERR;
+     }
+     for (block_number = 1; block_number <= last_block; block_number++)
+          bitmap[block_number / 32] |= 1 << (block_number % 32);
+
+     /* OACK the first client, others are OACKed by the thread that add
+        them to our list */
+     opt_options_to_string(data->tftp_options, string, MAXLEN);
+     if (data->trace)
+          logger(LOG_DEBUG, "sent OACK <%s>", string);
+     tftp_send_oack(sockfd, sa, data->tftp_options, data->data_buffer,
+                    data->data_buffer_size);
+
+     while (1)
+     {
+          /* stream all pending blocks, the last one ends the round */
+          for (block_number = 1; block_number <= last_block; block_number++)
+          {
+               if (!(bitmap[block_number / 32] & (1 << (block_number % 32))) &&
+                   (block_number != last_block))
+                    continue;
+               bitmap[block_number / 32] &= ~(1 << (block_number % 32));
+
+               if (tftpd_cancel)
+               {
+                    logger(LOG_DEBUG, "thread cancelled");
+                    tftp_send_error(sockfd, &data->sa_mcast, EUNDEF,
+                                    data->data_buffer, data->data_buffer_size);
+                    free(bitmap);
+                    return ERR;
+               }
+               data_size = tftp_file_read(fp, tftphdr->th_data, block_size,
+                                          block_number - 1, 0,
+                                          &prev_block_number, &prev_file_pos,
+                                          &temp);
+               if (data_size < 0)
+               {
+                    logger(LOG_ERR, "%s: %d: error reading block %ld",
+                           __FILE__, __LINE__, block_number);
+                    free(bitmap);
+                    return ERR;
+               }
+               tftpd_pacer_wait(&data->pacer, data_size + 4);
+               tftpd_pacer_wait(&tftpd_global_pacer, data_size + 4);
+               tftp_send_data(sockfd, &data->sa_mcast, block_number,
+                              data_size + 4, data->data_buffer);
+               sent++;
+               if (data->trace)
+                    logger(LOG_DEBUG, "sent DATA <block: %ld, size %d>",
+                           block_number, data_size);
+          }
+
+          /* collect reports until all clients have reported or none
+             arrive for REPAIR_WAIT seconds */
+          round++;
+          silent = 1;
+          while (tftpd_clientlist_pending(data, round) > 0)
+          {
+               if (tftpd_cancel)
+                    break;
+               data_size = data->data_buffer_size;
+               result = tftp_get_packet(sockfd, -1, NULL, sa, &from, NULL,
+                                        REPAIR_WAIT, &data_size,
+                                        data->data_buffer);
+               if (result == GET_TIMEOUT)
+                    break;
+               if ((result == GET_ERROR) ||
+                   ((result == GET_ACK) &&
+                    (ntohs(tftphdr->th_block) >= last_block)))
+               {
+                    silent = 0;
+                    if (tftpd_clientlist_done(data, NULL, &from) == 1)
+                         logger(LOG_DEBUG, "client done <%s>",
+                                sockaddr_print_addr(&from, addr_str,
+                                                    sizeof(addr_str)));
+                    continue;
+               }
+               if (result != GET_ACK)
+               {
+                    logger(LOG_WARNING, "packet discarded <%s>",
+                           sockaddr_print_addr(&from, addr_str,
+                                               sizeof(addr_str)));
+                    continue;
+               }
+
+               /* merge this report */
+               silent = 0;
+               block_number = ntohs(tftphdr->th_block) + 1;
+               bitmap[block_number / 32] |= 1 << (block_number % 32);
+               range = (unsigned short *)(data->data_buffer + 4);
+               for (i = 0; i < (data_size - 4) / 4; i++)
+               {
+                    first = ntohs(range[2 * i]);
+                    end = ntohs(range[2 * i + 1]);
+                    if (first < 1)
+                         first = 1;
+                    if (end > last_block)
+                         end = last_block;
+                    for (block_number = first; block_number <= end;
+                         block_number++)
+                         bitmap[block_number / 32] |= 1 << (block_number % 32);
+               }
+               if (data->trace)
+                    logger(LOG_DEBUG, "received report <block: %d, ranges: %d> from %s",
+                           ntohs(tftphdr->th_block), (data_size - 4) / 4,
+                           sockaddr_print_addr(&from, addr_str,
+                                               sizeof(addr_str)));
+               tftpd_clientlist_report(data, &from, round);
+          }
+
+          if (tftpd_clientlist_active(data) == 0)
+          {
+               logger(LOG_INFO, "No more client, end of transfers");
+               break;
+          }
+          if (silent)
+          {
+               if (++number_of_timeout > NB_OF_RETRY)
+               {
+                    logger(LOG_INFO, "clients not responding, end of transfers");
+                    break;
+               }
+          }
+          else
+               number_of_timeout = 0;
+     }
+     logger(LOG_INFO, "repair: %d rounds, %ld blocks sent for %ld blocks",
+            round, sent, last_block);
+     free(bitmap);
+     return OK;
+}
+
 /*
  * Receive a file. It is implemented as a state machine using a while loop
  * and a switch statement. Function flow is as follow:
@@ -145,6 +318,9 @@ int tftpd_receive_file(struct thread_data *data)
           return ERR;
      }
 
+     /* repair mode is only for multicast read */
+     opt_disable_options(data->tftp_options, "repair");
+
      /* tsize option */
      if (((result = opt_get_tsize(data->tftp_options)) > -1) && !convert)
      {
@@ -470,8 +646,12 @@ int tftpd_send_file(struct thread_data *data)
           return ERR;
      }
 
-     /* verify that the requested file exist */
-     fp = fopen(filename, "r");
+     /* verify that the requested file exist, the metadata come from the
+        stat cache when enabled */
+     if (tftpd_cache_stat(filename, &file_stat) == OK)
+          fp = fopen(filename, "r");
+     else
+          fp = NULL;
 
 #ifdef HAVE_PCRE
      if (fp == NULL)
@@ -502,7 +682,8 @@ int tftpd_send_file(struct thread_data *data)
                     /* write back the new file name to the option structure */
                     opt_set_options(data->tftp_options, "filename", filename);
                     /* try to open this new file */
-                    fp = fopen(filename, "r");
+                    if (tftpd_cache_stat(filename, &file_stat) == OK)
+                         fp = fopen(filename, "r");
                }
           }
      }
@@ -517,9 +698,6 @@ int tftpd_send_file(struct thread_data *data)
           return ERR;
      }
 
-     /* To return the size of the file with tsize argument */
-     fstat(fileno(fp), &file_stat);
-
      /* tsize option */
      if ((opt_get_tsize(data->tftp_options) > -1) && !convert)
      {
@@ -607,6 +785,22 @@ int tftpd_send_file(struct thread_data *data)
           return ERR;
      }
 
+     /* repair mode is only used with multicast, and block numbers can't
+        wrap around */
+     if (data->tftp_options[OPT_REPAIR].specified)
+     {
+          if (!data->tftp_options[OPT_REPAIR].enabled || convert ||
+              !data->tftp_options[OPT_MULTICAST].specified ||
+              !data->tftp_options[OPT_MULTICAST].enabled ||
+              ((file_stat.st_size / (data->data_buffer_size - 4)) >= 65535))
+               data->tftp_options[OPT_REPAIR].specified = 0;
+          else
+          {
+               opt_set_options(data->tftp_options, "repair", "1");
+               logger(LOG_INFO, "repair option -> 1");
+          }
+     }
+
      /* multicast option */
      if (data->tftp_options[OPT_MULTICAST].specified &&
          data->tftp_options[OPT_MULTICAST].enabled && !convert)
@@ -670,7 +864,8 @@ int tftpd_send_file(struct thread_data *data)
                struct addrinfo hints, *result;
 
                /* configure socket, get an IP address */
-               if (tftpd_mcast_get_tid(&data->mc_addr, &data->mc_port) != OK)
+               if (tftpd_mcast_get_tid(&data->mc_tid, &data->mc_addr,
+                                       &data->mc_port) != OK)
                {
                     logger(LOG_ERR, "No multicast address/port available");
                     fclose(fp);
@@ -718,9 +913,16 @@ int tftpd_send_file(struct thread_data *data)
                logger(LOG_INFO, "multicast option -> %s,%d,%d", data->mc_addr,
                       data->mc_port, 1);
             
-               /* the socket must be unconnected for multicast */
-               sa->ss_family = AF_UNSPEC;
-               connect(sockfd, (struct sockaddr *)sa, sizeof(*sa));
+               /* the socket must be unconnected for multicast. Don't
+                  clobber the client address, it is used to match its
+                  ACK */
+               memset(&from, 0, sizeof(from));
+               from.ss_family = AF_UNSPEC;
+               connect(sockfd, (struct sockaddr *)&from, sizeof(from));
+
+               /* pace DATA sent to the group */
+               tftpd_pacer_init(&data->pacer, data->mcast_rate,
+                                data->mcast_pps);
 
                /* set multicast flag */
                multicast = 1;
@@ -729,6 +931,14 @@ int tftpd_send_file(struct thread_data *data)
           }
      }
 
+     if (multicast && data->tftp_options[OPT_REPAIR].specified)
+     {
+          result = tftpd_send_repair(data, fp, file_stat.st_size /
+                                     (data->data_buffer_size - 4) + 1);
+          fclose(fp);
+          return result;
+     }
+
      /* copy options to local structure, used when falling back a client to slave */
      memcpy(options, data->tftp_options, sizeof(options));
      opt_set_multicast(options, data->mc_addr, data->mc_port, 0);
@@ -786,6 +996,8 @@ int tftpd_send_file(struct thread_data *data)
 
                if (multicast)
                {
+                    tftpd_pacer_wait(&data->pacer, data_size);
+                    tftpd_pacer_wait(&tftpd_global_pacer, data_size);
                     tftp_send_data(sockfd, &data->sa_mcast,
                                    block_number + 1, data_size,
                                    data->data_buffer);
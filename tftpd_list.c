@@ -23,6 +23,7 @@
 #include <signal.h>
 #include "tftpd.h"
 #include "logger.h"
+#include "stats.h"
 
 /*
  * thread_data is a double link list of server threads. Server threads
@@ -128,6 +129,117 @@ int tftpd_list_num_of_thread(void)
      return ret;
 }
 
+/*
+ * Hash of a client address and port.
+ */
+static unsigned int tftpd_clientlist_hash(struct sockaddr_storage *sock)
+{
+     unsigned int hash = sockaddr_get_port(sock);
+     unsigned int *word;
+     int i;
+
+     if (sock->ss_family == AF_INET)
+          hash ^= ((struct sockaddr_in *)sock)->sin_addr.s_addr;
+     else if (sock->ss_family == AF_INET6)
+     {
+          word = (unsigned int *)&((struct sockaddr_in6 *)sock)->sin6_addr;
+          for (i = 0; i < 4; i++)
+               hash ^= word[i];
+     }
+     hash ^= hash >> 16;
+     hash ^= hash >> 8;
+     return hash & (CLIENT_HASH_SIZE - 1);
+}
+
+/*
+ * Find a client not done by its address. Client mutex must be locked.
+ */
+static struct client_info *tftpd_clientlist_find(struct thread_data *thread,
+                                                 struct sockaddr_storage *sock)
+{
+     struct client_info *tmp;
+
+     if (thread->client_hash == NULL)
+          return NULL;
+     tmp = thread->client_hash[tftpd_clientlist_hash(sock)];
+     while (tmp)
+     {
+          if (sockaddr_equal(sock, &tmp->client))
+               return tmp;
+          tmp = tmp->hnext;
+     }
+     return NULL;
+}
+
+/*
+ * Index a new client and insert it in the ring just before the next one
+ * to be served, so it is served last. Client mutex must be locked.
+ */
+static void tftpd_clientlist_insert(struct thread_data *thread,
+                                    struct client_info *client)
+{
+     unsigned int hash = tftpd_clientlist_hash(&client->client);
+
+     client->done = 0;
+     client->hnext = thread->client_hash[hash];
+     thread->client_hash[hash] = client;
+
+     if (thread->client_ring == NULL)
+     {
+          client->next = client;
+          client->prev = client;
+          thread->client_ring = client;
+     }
+     else
+     {
+          client->next = thread->client_ring;
+          client->prev = thread->client_ring->prev;
+          client->prev->next = client;
+          client->next->prev = client;
+     }
+     thread->client_count++;
+}
+
+/*
+ * Mark a client done and remove it from the hash and the ring. It is freed
+ * unless it is the master. Client mutex must be locked.
+ */
+static void tftpd_clientlist_unlink(struct thread_data *thread,
+                                    struct client_info *client)
+{
+     struct client_info **prev;
+
+     if (client->done)
+          return;
+     client->done = 1;
+     if (thread->client_hash == NULL)
+          return;
+
+     prev = &thread->client_hash[tftpd_clientlist_hash(&client->client)];
+     while (*prev && (*prev != client))
+          prev = &(*prev)->hnext;
+     if (*prev)
+          *prev = client->hnext;
+
+     if (client->next == client)
+          thread->client_ring = NULL;
+     else
+     {
+          client->prev->next = client->next;
+          client->next->prev = client->prev;
+          if (thread->client_ring == client)
+               thread->client_ring = client->next;
+     }
+     client->next = NULL;
+     client->prev = NULL;
+     thread->client_count--;
+     if ((thread->report_round > 0) && (client->round == thread->report_round))
+          thread->client_reported--;
+
+     if (client != thread->client_info)
+          free(client);
+}
+
 /*
  * This function looks for a thread serving exactly the same
  * file and with the same options as another client. This implies a
@@ -142,11 +254,11 @@ int tftpd_list_find_multicast_server_and_add(struct thread_data **thread,
 
      struct thread_data *current = thread_data; /* head of the list */
      struct tftp_opt *tftp_options = data->tftp_options;
-     struct client_info *tmp;
      char options[MAXLEN];
      char string[MAXLEN];
      char *index;
      int len;
+     int full = 0;
 
      *thread = NULL;
 
@@ -163,29 +275,34 @@ int tftpd_list_find_multicast_server_and_add(struct thread_data **thread,
                if (current->client_ready == 1)
                {
                     opt_request_to_string(current->tftp_options, string, MAXLEN);
-                    /* must have exact same option string */
-                    if (strncmp(string, options, len) == 0)
+                    /* must have exact same option string and both in repair
+                       mode or not */
+                    if ((strncmp(string, options, len) == 0) &&
+                        (current->tftp_options[OPT_REPAIR].specified ==
+                         tftp_options[OPT_REPAIR].specified))
                     {
-                         *thread = current;                         
-                         /* insert the new client at the end. If the client is already
-                            in the list, don't add it again. */
-                         tmp = current->client_info;
-
-                         while (1)
+                         /* If the client is already in the list, don't add
+                            it again. */
+                         if (tftpd_clientlist_find(current, &client->client))
+                         {
+                              *thread = current;
+                              /* unlock mutex and exit */
+                              pthread_mutex_unlock(&current->client_mutex);
+                              pthread_mutex_unlock(&thread_list_mutex);
+                              return 2;
+                         }
+                         /* session is full, look for another one */
+                         if ((current->mcast_max_clients > 0) &&
+                             (current->client_count >=
+                              current->mcast_max_clients))
                          {
-                              if (sockaddr_equal(&tmp->client, &client->client) &&
-                                  (tmp->done == 0))
-                              {
-                                   /* unlock mutex and exit */
-                                   pthread_mutex_unlock(&current->client_mutex);
-                                   pthread_mutex_unlock(&thread_list_mutex);
-                                   return 2;
-                              }
-                              if (tmp->next == NULL)
-                                   break;
-                              tmp = tmp->next;
+                              full = 1;
+                              pthread_mutex_unlock(&current->client_mutex);
+                              current = current->next;
+                              continue;
                          }
-                         tmp->next = client;
+                         *thread = current;
+                         tftpd_clientlist_insert(current, client);
                          /* unlock mutex and exit */
                          pthread_mutex_unlock(&current->client_mutex);                    
                          pthread_mutex_unlock(&thread_list_mutex);
@@ -197,31 +314,48 @@ int tftpd_list_find_multicast_server_and_add(struct thread_data **thread,
           current = current->next;
      }
      pthread_mutex_unlock(&thread_list_mutex);
-     
+
+     /* the caller starts a new session */
+     if (full)
+     {
+          logger(LOG_INFO, "All multicast sessions for this file are full, "
+                 "starting a new one");
+          stats_mcast_split_locked();
+     }
      return 0;
 }
 
-inline void tftpd_clientlist_ready(struct thread_data *thread)
+/*
+ * Allow other threads to add clients. The client index is allocated
+ * and the master client is its first entry.
+ */
+void tftpd_clientlist_ready(struct thread_data *thread)
 {
      pthread_mutex_lock(&thread->client_mutex);
+     if (thread->client_hash == NULL)
+     {
+          if ((thread->client_hash = calloc(CLIENT_HASH_SIZE,
+                                            sizeof(struct client_info *))) == NULL)
+          {
+               logger(LOG_ERR, "%s: %d: Memory allocation failed",
+                      __FILE__, __LINE__);
+               pthread_mutex_unlock(&thread->client_mutex);
+               return;
+          }
+          tftpd_clientlist_insert(thread, thread->client_info);
+     }
      thread->client_ready = 1;
      pthread_mutex_unlock(&thread->client_mutex);
 }
 
 /*
- * As of the the above comment, we never remove the head element.
+ * Remove a client from the list. The master client is never freed here.
  */
 void tftpd_clientlist_remove(struct thread_data *thread,
                              struct client_info *client)
 {
      pthread_mutex_lock(&thread->client_mutex);
-     struct client_info *tmp = thread->client_info;
-
-     while ((tmp->next != client) && (tmp->next != NULL))
-          tmp = tmp->next;
-     if (tmp->next == NULL)
-          return;
-     tmp->next = tmp->next->next;
+     tftpd_clientlist_unlink(thread, client);
      pthread_mutex_unlock(&thread->client_mutex);
 }
 
@@ -233,14 +367,30 @@ void tftpd_clientlist_free(struct thread_data *thread)
      pthread_mutex_lock(&thread->client_mutex);
 
      struct client_info *tmp;
-     struct client_info *head = thread->client_info;
+     struct client_info *head;
+     int i;
 
-     while (head)
+     if (thread->client_hash)
      {
-          tmp = head;
-          head = head->next;
-          free(tmp);
+          for (i = 0; i < CLIENT_HASH_SIZE; i++)
+          {
+               head = thread->client_hash[i];
+               while (head)
+               {
+                    tmp = head;
+                    head = head->hnext;
+                    if (tmp != thread->client_info)
+                         free(tmp);
+               }
+          }
+          free(thread->client_hash);
+          thread->client_hash = NULL;
      }
+     if (thread->client_info)
+          free(thread->client_info);
+     thread->client_info = NULL;
+     thread->client_ring = NULL;
+     thread->client_count = 0;
      pthread_mutex_unlock(&thread->client_mutex);
 }
 
@@ -253,29 +403,14 @@ int tftpd_clientlist_done(struct thread_data *thread,
 {
      pthread_mutex_lock(&thread->client_mutex);
 
-     struct client_info *head = thread->client_info;
-
+     if ((client == NULL) && sock)
+          client = tftpd_clientlist_find(thread, sock);
      if (client)
      {
-          client->done = 1;
+          tftpd_clientlist_unlink(thread, client);
           pthread_mutex_unlock(&thread->client_mutex);
           return 1;
      }
-     if (sock)
-     {
-          /* walk the list to find this client */
-          while (head)
-          {
-               if (sockaddr_equal(sock, &head->client))
-               {
-                    head->done = 1;
-                    pthread_mutex_unlock(&thread->client_mutex);
-                    return 1;
-               }
-               else
-                    head = head->next;
-          }
-     }
      pthread_mutex_unlock(&thread->client_mutex);
      return 0;
 }
@@ -286,7 +421,8 @@ int tftpd_clientlist_done(struct thread_data *thread,
  * If no more client are available, 0 is returned and client_ready is unset
  * If the new client is the same, -1 is returned.
  *
- * List is search from the current client address and wrap around.
+ * The ring is walked from the current client. If the current client is
+ * done, the next one takes its place as master and it is freed.
  */
 int tftpd_clientlist_next(struct thread_data *thread,
                           struct client_info **client)
@@ -295,42 +431,93 @@ int tftpd_clientlist_next(struct thread_data *thread,
 
      pthread_mutex_lock(&thread->client_mutex);
 
-     /* If there's a next, start with it. Else search from the
-        beginning */
-     if ((*client)->next)
-          tmp = (*client)->next;
+     if ((*client)->done)
+          tmp = thread->client_ring;
      else
-          tmp = thread->client_info;
+          tmp = (*client)->next;
 
-     /* search from the current client */
-     while (tmp)
+     if (tmp == NULL)
      {
-          if (!tmp->done)
-          {
-               /* If this is the same as *client */
-               if (tmp == *client)
-               {
-                    pthread_mutex_unlock(&thread->client_mutex);
-                    return -1;
-               }
-               *client = tmp;
-               pthread_mutex_unlock(&thread->client_mutex);
-               return 1;
-          }
-          tmp = tmp->next;
-          /* if no more entry, start at begining */
-          if (tmp == NULL)
-               tmp = thread->client_info;
-          /* if we fall back on the current client, there is no more
-             client to serve */
-          if (tmp == *client)
-               tmp = NULL;
+          /* There is no more client to server */
+          thread->client_ready = 0;
+          *client = NULL;
+          pthread_mutex_unlock(&thread->client_mutex);
+          return 0;
      }
-     /* There is no more client to server */
-     thread->client_ready = 0;
-     *client = NULL;
+     if (tmp == *client)
+     {
+          pthread_mutex_unlock(&thread->client_mutex);
+          return -1;
+     }
+     if ((*client)->done && (*client == thread->client_info))
+          free(*client);
+     thread->client_info = tmp;
+     thread->client_ring = tmp;
+     *client = tmp;
      pthread_mutex_unlock(&thread->client_mutex);
-     return 0;
+     return 1;
+}
+
+/*
+ * Record that a client sent its report for this repair round. Return 1
+ * if the client is in the list.
+ */
+int tftpd_clientlist_report(struct thread_data *thread,
+                            struct sockaddr_storage *sock, int round)
+{
+     pthread_mutex_lock(&thread->client_mutex);
+
+     struct client_info *client = tftpd_clientlist_find(thread, sock);
+
+     if (thread->report_round != round)
+     {
+          thread->report_round = round;
+          thread->client_reported = 0;
+     }
+     if (client == NULL)
+     {
+          pthread_mutex_unlock(&thread->client_mutex);
+          return 0;
+     }
+     if (client->round != round)
+     {
+          client->round = round;
+          thread->client_reported++;
+     }
+     pthread_mutex_unlock(&thread->client_mutex);
+     return 1;
+}
+
+/*
+ * Return the number of clients not done that have not yet reported for
+ * this repair round.
+ */
+int tftpd_clientlist_pending(struct thread_data *thread, int round)
+{
+     int count;
+
+     pthread_mutex_lock(&thread->client_mutex);
+     count = thread->client_count;
+     if (thread->report_round == round)
+          count -= thread->client_reported;
+     pthread_mutex_unlock(&thread->client_mutex);
+     return count;
+}
+
+/*
+ * Return the number of clients not done. When there is none, client_ready
+ * is unset under the same lock so no more client can be added.
+ */
+int tftpd_clientlist_active(struct thread_data *thread)
+{
+     int count;
+
+     pthread_mutex_lock(&thread->client_mutex);
+     count = thread->client_count;
+     if (count == 0)
+          thread->client_ready = 0;
+     pthread_mutex_unlock(&thread->client_mutex);
+     return count;
 }
 
 void tftpd_list_kill_threads(void)
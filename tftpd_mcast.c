@@ -23,6 +23,7 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <time.h>
 #include "tftpd.h"
 #include "tftp_def.h"
 #include "logger.h"
@@ -37,60 +38,89 @@ pthread_mutex_t mcast_tid_list = PTHREAD_MUTEX_INITIALIZER;
 int parse_ip(char *string, char **res_ip);
 int parse_port(char *string, char **res_port);
 
-struct tid {
-     char *addr;
-     short port;
-     int used;
-     struct tid *next;
-};
+/*
+ * The address/port space built from --mcast-addr and --mcast-port. TID
+ * number i is address i / tid_nport with port i % tid_nport. Free TIDs are
+ * kept in a FIFO so the one freed the longest time ago is reused first.
+ * A TID freed less than TID_QUARANTINE seconds ago is only handed out when
+ * nothing else is free, late packets for the previous session may still
+ * be in flight.
+ */
+#define TID_QUARANTINE 10
+
+static char **tid_addr = NULL;  /* addresses */
+static int tid_naddr = 0;
+static short *tid_port = NULL;  /* ports */
+static int tid_nport = 0;
+static int tid_number = 0;      /* tid_naddr * tid_nport */
 
-struct tid *tid_list = NULL;
+static int *tid_fifo = NULL;    /* free TIDs */
+static int tid_head = 0;
+static int tid_free = 0;
+static char *tid_used = NULL;
+static time_t *tid_released = NULL;
+
+static int tid_high_water = 0;  /* statistics */
+static int tid_quarantine_hit = 0;
 
 /*
  * Return a free IP/Port for the multicast transfer
  */
-int tftpd_mcast_get_tid(char **addr, short *port)
+int tftpd_mcast_get_tid(int *tid, char **addr, short *port)
 {
-     struct tid *current = tid_list;
+     int i;
 
      pthread_mutex_lock(&mcast_tid_list);
-     /* walk the list for a free tid */
-     while (current != NULL)
+     if (tid_free == 0)
      {
-	  if (current->used == 0)
-	  {
-	       *addr = current->addr;
-	       *port = current->port;
-	       current->used = 1;
-	       pthread_mutex_unlock(&mcast_tid_list);
-	       return OK;
-	  }
-	  else
-	       current = current->next;
+          pthread_mutex_unlock(&mcast_tid_list);
+          return ERR;
      }
+     i = tid_fifo[tid_head];
+     tid_head = (tid_head + 1) % tid_number;
+     tid_free--;
+     if (tid_released[i] &&
+         (time(NULL) - tid_released[i] < TID_QUARANTINE))
+          tid_quarantine_hit++;
+     tid_used[i] = 1;
+     if (tid_number - tid_free > tid_high_water)
+          tid_high_water = tid_number - tid_free;
      pthread_mutex_unlock(&mcast_tid_list);
-     return ERR;
+
+     *tid = i;
+     *addr = tid_addr[i / tid_nport];
+     *port = tid_port[i % tid_nport];
+     return OK;
 }
 
-int tftpd_mcast_free_tid(char *addr, short port)
+int tftpd_mcast_free_tid(int tid)
 {
-     struct tid *current = tid_list;
-
      pthread_mutex_lock(&mcast_tid_list);
-     while (current != NULL)
+     if ((tid < 0) || (tid >= tid_number) || !tid_used[tid])
      {
-	  if ((current->used == 1) && (current->port == port) &&
-	      (strcmp(current->addr, addr) == 0))
-	  {
-	       current->used = 0;
-	       pthread_mutex_unlock(&mcast_tid_list);
-	       return OK;
-	  }
-	  else
-	       current = current->next;
+          pthread_mutex_unlock(&mcast_tid_list);
+          return ERR;
      }
+     tid_used[tid] = 0;
+     tid_released[tid] = time(NULL);
+     tid_fifo[(tid_head + tid_free) % tid_number] = tid;
+     tid_free++;
+     pthread_mutex_unlock(&mcast_tid_list);
+     return OK;
+}
+
+/*
+ * Print usage of the multicast address/port space.
+ */
+void tftpd_mcast_print(void)
+{
+     pthread_mutex_lock(&mcast_tid_list);
+     logger(LOG_INFO, "  Multicast address/port:");
+     logger(LOG_INFO, "   in use:                   %d/%d",
+            tid_number - tid_free, tid_number);
+     logger(LOG_INFO, "   high water mark:          %d", tid_high_water);
+     logger(LOG_INFO, "   reused in quarantine:     %d", tid_quarantine_hit);
      pthread_mutex_unlock(&mcast_tid_list);
-     return ERR;
 }
 
 /* valid address specification:
@@ -107,9 +137,24 @@ int tftpd_mcast_parse_opt(char *addr, char *ports)
 {
      char *ip;
      char *port;
-     struct tid *current = NULL;
-     struct tid *tmp = NULL;
+     int i;
 
+     /* the port list is the same for all addresses */
+     while (1)
+     {
+          if (parse_port(ports, &port) != OK)
+          {
+               printf("unable to parse port\n");
+               return ERR;
+          }
+          if (port == NULL)
+               break;
+          if ((tid_nport % 16) == 0)
+               tid_port = realloc(tid_port, (tid_nport + 16) * sizeof(short));
+          if (tid_port == NULL)
+               return ERR;
+          tid_port[tid_nport++] = (short)atoi(port);
+     }
      while (1)
      {
 	  if (parse_ip(addr, &ip) !=  OK)
@@ -118,40 +163,46 @@ int tftpd_mcast_parse_opt(char *addr, char *ports)
 	       return ERR;
           }
 	  if (ip == NULL)
-	       return OK;
-	  while (1)
-	  {
-	       if (parse_port(ports, &port) != OK)
-               {
-		    printf("unable to parse port\n");
-		    return ERR;
-               }
-	       if (port == NULL)
-		    break;
-	       /* add this ip/port to the tid list */
-	       tmp = malloc(sizeof(struct tid));
-	       tmp->addr = strdup(ip);
-	       tmp->port = (short)atoi(port);
-	       tmp->used = 0;
-	       tmp->next = NULL;
-	       if (tid_list == NULL)
-	       {
-		    tid_list = tmp;
-		    current = tid_list;
-	       }
-	       else
-	       {
-		    current->next = tmp;
-		    current = tmp;
-	       }
-	  }
+	       break;
+          if ((tid_naddr % 16) == 0)
+               tid_addr = realloc(tid_addr, (tid_naddr + 16) * sizeof(char *));
+          if (tid_addr == NULL)
+               return ERR;
+          tid_addr[tid_naddr++] = strdup(ip);
      }
+
+     tid_number = tid_naddr * tid_nport;
+     if (tid_number == 0)
+          return OK;
+     tid_fifo = malloc(tid_number * sizeof(int));
+     tid_used = calloc(tid_number, sizeof(char));
+     tid_released = calloc(tid_number, sizeof(time_t));
+     if (!tid_fifo || !tid_used || !tid_released)
+          return ERR;
+     for (i = 0; i < tid_number; i++)
+          tid_fifo[i] = i;
+     tid_head = 0;
+     tid_free = tid_number;
+     return OK;
 }
 
 void tftpd_mcast_clean(void)
 {
+     int i;
 
-
+     for (i = 0; i < tid_naddr; i++)
+          free(tid_addr[i]);
+     free(tid_addr);
+     free(tid_port);
+     free(tid_fifo);
+     free(tid_used);
+     free(tid_released);
+     tid_addr = NULL;
+     tid_port = NULL;
+     tid_fifo = NULL;
+     tid_used = NULL;
+     tid_released = NULL;
+     tid_naddr = tid_nport = tid_number = tid_free = 0;
 }
 
 int parse_ip(char *string, char **res_ip)
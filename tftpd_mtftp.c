@@ -60,8 +60,9 @@ extern int tftpd_cancel;
 /* 
  * This function parse the configuration file and create data structure
  * Format is:
- *   filename mcast_ip client_port
- * one entry per line
+ *   filename mcast_ip client_port [rate [pps]]
+ * one entry per line. rate and pps pace the multicast DATA in bytes and
+ * packets per second, they default to --mcast-rate and --mcast-pps.
  */
 struct mtftp_data *tftpd_mtftp_init(char *filename)
 {
@@ -168,11 +169,21 @@ struct mtftp_data *tftpd_mtftp_init(char *filename)
                continue;
           Strncpy(thread->mcast_ip, token, MAXLEN);
 
-          token = strtok(NULL, " ");
+          token = strtok(NULL, " \t\n");
           if (!token)
                continue;
           Strncpy(thread->client_port, token, MAXLEN);
 
+          /* optional pacing */
+          thread->rate = -1;
+          thread->pps = -1;
+          if ((token = strtok(NULL, " \t\n")) != NULL)
+          {
+               thread->rate = atoi(token);
+               if ((token = strtok(NULL, " \t\n")) != NULL)
+                    thread->pps = atoi(token);
+          }
+
           /* validate arguements */
           /* file name verification */
           if (tftpd_rules_check(thread->file_name) != OK)
@@ -487,6 +498,11 @@ void *tftpd_mtftp_server(void *arg)
                /* give server thread access to mtftp options */
                thread->mtftp_data = data;
 
+               /* pace multicast DATA */
+               tftpd_pacer_init(&thread->pacer,
+                                (thread->rate < 0) ? data->mcast_rate : thread->rate,
+                                (thread->pps < 0) ? data->mcast_pps : thread->pps);
+
                /* mask the thread as running */
                thread->running = 1;
 
@@ -585,6 +601,8 @@ void *tftpd_mtftp_send_file(void *arg)
                if (feof(data->fp))
                     last_block = block_number;
                /* send data to multicast address */
+               tftpd_pacer_wait(&data->pacer, data_size);
+               tftpd_pacer_wait(&tftpd_global_pacer, data_size);
                tftp_send_data(sockfd, &data->sa_mcast,
                               block_number + 1, data_size,
                               data->data_buffer);
@@ -22,6 +22,7 @@
 #include <arpa/inet.h>
 #include "tftp_io.h"
 #include "options.h"
+#include "tftpd_pacer.h"
 
 /*
  * This structure hold information on mtftp configuration
@@ -42,6 +43,8 @@ struct mtftp_data {
      int timeout;
      int checkport;
      int trace;
+     int mcast_rate;            /* default pacing, see tftpd_pacer.c */
+     int mcast_pps;
 };
 
 struct mtftp_thread {
@@ -65,6 +68,10 @@ struct mtftp_thread {
      struct sockaddr_storage sa_mcast;
      union ip_mreq_storage mcastaddr;
 
+     int rate;                  /* from configuration, -1 for default */
+     int pps;
+     struct tftpd_pacer pacer;
+
      char *data_buffer;
      int data_buffer_size;
 
@@ -0,0 +1,101 @@
+/* hey emacs! -*- Mode: C; c-file-style: "k&r"; indent-tabs-mode: nil -*- */
+/*
+ * tftpd_pacer.c
+ *    token bucket used to pace multicast transmission
+ *
+ * $Id$
+ *
+ * Copyright (c) 2000 Jean-Pierre Lefebvre <helix@step.polymtl.ca>
+ *                and Remi Lefebvre <remi@debian.org>
+ *
+ * atftp is free software; you can redistribute them and/or modify them
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include "tftpd_pacer.h"
+
+struct tftpd_pacer tftpd_global_pacer = { PTHREAD_MUTEX_INITIALIZER };
+
+/*
+ * Set the rates of a pacer, the bucket starts full.
+ */
+void tftpd_pacer_init(struct tftpd_pacer *pacer, int byte_rate,
+                      int packet_rate)
+{
+     pthread_mutex_init(&pacer->mutex, NULL);
+     pacer->byte_rate = (byte_rate > 0) ? byte_rate : 0;
+     pacer->packet_rate = (packet_rate > 0) ? packet_rate : 0;
+
+     /* the bucket must hold at least one packet */
+     pacer->byte_burst = pacer->byte_rate * PACER_BURST_MS / 1000;
+     if (pacer->byte_burst < 1500)
+          pacer->byte_burst = 1500;
+     pacer->packet_burst = pacer->packet_rate * PACER_BURST_MS / 1000;
+     if (pacer->packet_burst < 1)
+          pacer->packet_burst = 1;
+
+     pacer->bytes = pacer->byte_burst;
+     pacer->packets = pacer->packet_burst;
+     clock_gettime(CLOCK_MONOTONIC, &pacer->last);
+}
+
+/*
+ * Take size bytes and one packet from the bucket, sleeping until they
+ * would have been available. Tokens are taken before sleeping so
+ * concurrent callers queue up behind each other instead of all waking
+ * up at the same time.
+ */
+void tftpd_pacer_wait(struct tftpd_pacer *pacer, int size)
+{
+     struct timespec now;
+     struct timespec delay;
+     double elapsed;
+     double wait = 0;
+
+     if ((pacer->byte_rate == 0) && (pacer->packet_rate == 0))
+          return;
+
+     pthread_mutex_lock(&pacer->mutex);
+     clock_gettime(CLOCK_MONOTONIC, &now);
+     elapsed = (now.tv_sec - pacer->last.tv_sec) +
+          (now.tv_nsec - pacer->last.tv_nsec) * 1e-9;
+     memcpy(&pacer->last, &now, sizeof(now));
+
+     if (pacer->byte_rate > 0)
+     {
+          pacer->bytes += elapsed * pacer->byte_rate;
+          if (pacer->bytes > pacer->byte_burst)
+               pacer->bytes = pacer->byte_burst;
+          pacer->bytes -= size;
+          if (pacer->bytes < 0)
+               wait = -pacer->bytes / pacer->byte_rate;
+     }
+     if (pacer->packet_rate > 0)
+     {
+          pacer->packets += elapsed * pacer->packet_rate;
+          if (pacer->packets > pacer->packet_burst)
+               pacer->packets = pacer->packet_burst;
+          pacer->packets -= 1;
+          if ((pacer->packets < 0) &&
+              (-pacer->packets / pacer->packet_rate > wait))
+               wait = -pacer->packets / pacer->packet_rate;
+     }
+     pthread_mutex_unlock(&pacer->mutex);
+
+     if (wait > 0)
+     {
+          delay.tv_sec = (time_t)wait;
+          delay.tv_nsec = (long)((wait - delay.tv_sec) * 1e9);
+          while ((nanosleep(&delay, &delay) == -1) && (errno == EINTR))
+               ;
+     }
+}
@@ -0,0 +1,49 @@
+/* hey emacs! -*- Mode: C; c-file-style: "k&r"; indent-tabs-mode: nil -*- */
+/*
+ * tftpd_pacer.h
+ *
+ * $Id$
+ *
+ * Copyright (c) 2000 Jean-Pierre Lefebvre <helix@step.polymtl.ca>
+ *                and Remi Lefebvre <remi@debian.org>
+ *
+ * atftp is free software; you can redistribute them and/or modify them
+ * under the terms of the GNU General Public License as published by the
+ * Free Software Foundation; either version 2 of the License, or (at your
+ * option) any later version.
+ *
+ */
+
+#ifndef tftpd_pacer_h
+#define tftpd_pacer_h
+
+#include <pthread.h>
+#include <time.h>
+
+#define PACER_BURST_MS 10       /* bucket depth, in ms of traffic */
+
+/*
+ * Token bucket limiting both bytes and packets per second. A rate of 0
+ * is unlimited. The mutex is only needed when the pacer is shared by
+ * many threads, like the global one.
+ */
+struct tftpd_pacer {
+     pthread_mutex_t mutex;
+     double byte_rate;
+     double packet_rate;
+     double byte_burst;
+     double packet_burst;
+     double bytes;              /* tokens available, negative when */
+     double packets;            /* packets were sent in advance */
+     struct timespec last;      /* last refill */
+};
+
+/* shared by all multicast sessions and mtftp */
+extern struct tftpd_pacer tftpd_global_pacer;
+
+/* Functions defined in tftpd_pacer.c */
+void tftpd_pacer_init(struct tftpd_pacer *pacer, int byte_rate,
+                      int packet_rate);
+void tftpd_pacer_wait(struct tftpd_pacer *pacer, int size);
+
+#endif